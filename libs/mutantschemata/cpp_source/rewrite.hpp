@@ -280,6 +280,88 @@ bool calculateOffsetLoc(clang::SourceLocation Loc, const clang::FileEntry*& fE,
 ///////////////////////////////////////////////////////////////////////////////|
 
 // functionality to write changed files to disk \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\|
+/**
+ * Runtime injected in each mutated TU.
+ *
+ * MUTANT_NR reads a weak global thus all TUs share the same definition. It is
+ * initialized from the environment variable MUTANT_NR the first time a
+ * schemata is executed.
+ *
+ * When the environment variable DEXTOOL_SCHEMATA_FORKSRV is set to a
+ * directory the binary become a fork server (similar to AFL). It stops at the
+ * first schemata that is executed and, for each mutant id read from the fifo
+ * DIR/ctl, forks a child that continues from there with MUTANT_NR set to the
+ * id. The pid and the wait status of the child are written to the fifo
+ * DIR/status. The code that runs before the first schemata is unaffected by
+ * the mutants thus the dynamic linking, the static initializers and whatever
+ * the program does up to that point is only done once, in the server.
+ *
+ * The fork is done lazily instead of in a constructor because the order of
+ * the constructors in relation to the static initializers of the program is
+ * decided by the link order. A fork before the static initializers would
+ * re-run them in each child.
+ *
+ * Note that only the thread that executes the first schemata exist in the
+ * children. A binary that starts threads before that should not be used as a
+ * fork server.
+ */
+static const char* forkServerRuntime = R"(#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern "C" {
+__attribute__((weak)) int dextool_schemata_mutant_nr = 0;
+__attribute__((weak)) int dextool_schemata_initialized = 0;
+__attribute__((weak, noinline)) void dextool_schemata_init(void) {
+    if (dextool_schemata_initialized)
+        return;
+    dextool_schemata_initialized = 1;
+    const char* nr = getenv("MUTANT_NR");
+    dextool_schemata_mutant_nr = nr ? atoi(nr) : 0;
+    const char* dir = getenv("DEXTOOL_SCHEMATA_FORKSRV");
+    if (!dir)
+        return;
+    char status_p[4096];
+    char ctl_p[4096];
+    snprintf(status_p, sizeof(status_p), "%s/status", dir);
+    snprintf(ctl_p, sizeof(ctl_p), "%s/ctl", dir);
+    unsetenv("DEXTOOL_SCHEMATA_FORKSRV");
+    int st = open(status_p, O_WRONLY);
+    int ctl = open(ctl_p, O_RDONLY);
+    if (st < 0 || ctl < 0)
+        _exit(1);
+    int msg = 0;
+    if (write(st, &msg, sizeof(msg)) != sizeof(msg))
+        _exit(1);
+    while (read(ctl, &msg, sizeof(msg)) == sizeof(msg)) {
+        pid_t pid = fork();
+        if (pid < 0)
+            _exit(1);
+        if (pid == 0) {
+            close(st);
+            close(ctl);
+            dextool_schemata_mutant_nr = msg;
+            return;
+        }
+        int status = 0;
+        if (write(st, &pid, sizeof(pid)) != sizeof(pid) || waitpid(pid, &status, 0) < 0)
+            _exit(1);
+        if (write(st, &status, sizeof(status)) != sizeof(status))
+            _exit(1);
+    }
+    _exit(0);
+}
+static inline int dextool_schemata_nr(void) {
+    if (__builtin_expect(!dextool_schemata_initialized, 0))
+        dextool_schemata_init();
+    return dextool_schemata_mutant_nr;
+}
+}
+#define MUTANT_NR (dextool_schemata_nr())
+)";
+
 /**
  * Write the modified AST to files.
  * Either in place, or with suffix _mutated
@@ -312,12 +394,7 @@ void writeChangedFiles(bool inPlace) {
                     std::string include;
                     include = "#ifndef schemataFunctions_h\n";
                     include += "#define schemataFunctions_h\n";
-                    include += "#include <cstdlib>\n";
-                    include += "static const int MUTANT_NR = std::atoi(getenv(\"MUTANT_NR\"));\n";
-                    //                    include += "static void __schemataENVSetter(void)
-                    //                    __attribute__((constructor));\n"; include += "static void
-                    //                    __schemataENVSetter(void) {MUTANT_NR =
-                    //                    std::atoi(getenv(\"MUTANT_NR\"));}\n";
+                    include += forkServerRuntime;
                     include += "#endif /* schemataFunctions_h */\n";
                     include += "\n";
 
@@ -343,19 +420,6 @@ void writeChangedFiles(bool inPlace) {
     }
 }
 
-/**
- * write the temporary files over the original ones
- */
-void overWriteChangedFile() {
-    for (std::string fileName : VisitedSourcePaths) {
-        // deletes the old file
-        std::string oldFileName = fileName + "_mutated";
-        if (std::rename(oldFileName.c_str(), fileName.c_str()) != 0) {
-            std::string err = "Error renaming file, " + oldFileName + " not found";
-            std::perror(err.c_str());
-        }
-    }
-}
 ///////////////////////////////////////////////////////////////////////////////|
 
 enum Singleton { LHS, RHS, False, True, NotASingleTon };
@@ -1107,14 +1171,15 @@ int main(int argc, const char** argv) {
     int result = Tool.run(clang::tooling::newFrontendActionFactory<MutationFrontendAction>().get());
 
     /*
-     * move newly created files onto the old files
+     * The meta-mutants are left in the temporary files next to the original
+     * ones (<file>_mutated). The test phase install them when the mutants are
+     * tested via the schemata and restore the original files afterwards.
      * Caling rewriter.overwriteChangedFiles() here causes a segmentation fault
      * as some rewrite buffers are already deconstructed.
      * Calling it in the EndSourceFileAction causes a sementation fault
      * in clang's sourcemaneger calling the ComputeLineNumbers function.
      * This is why we need to use temp files.
      */
-    overWriteChangedFile();
 
     llvm::errs() << "Mutations found: " << mutant_count << "\n";
     llvm::errs() << "Mutations inserted: " << insertedMutants_count << "\n";